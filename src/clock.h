@@ -0,0 +1,17 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+// Clock policies for Control<Sensor, Converter, Output, Clock>
+//
+// A clock provides
+//   uint32_t millis() const           milliseconds since boot
+
+#include <Arduino.h>
+
+
+class MillisClock {
+public:
+  uint32_t millis() const { return ::millis(); }
+};
+
+#endif
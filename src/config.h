@@ -32,11 +32,36 @@
 #define PID_K_P          0.6
 #define PID_K_I          0.1
 #define PID_K_D          0.8
+#define PID_INTERVAL_MS  100                // pid step interval
+#define PID_MIN_ERROR    0.2                // celsius, smaller errors are noise
+#define PID_MAX_SUM      100                // duty percent, integral part wind up limit
+
+// PID gain schedule, gains are interpolated by set point between bands
+// Entries are { celsius, kp, ki, kd } with strictly ascending celsius
+#define PID_BANDS        3
+#define PID_GAINS        { {  50, PID_K_P, PID_K_I, PID_K_D }, \
+                           { 150, PID_K_P, PID_K_I, PID_K_D }, \
+                           { 240, PID_K_P, PID_K_I, PID_K_D } }
+
+// Persisted settings are only restored if EEPROM starts with this
+#define EEPROM_MAGIC     0x52666c31
 
 // Analog samples for averaging
 #define A_SAMPLES        4000
 #define A_MAX            1023
 
+// Analog sampling by ticker, A0 is left to WIFI for A_WIFI_MS of every A_WINDOW_MS
+#define A_SAMPLE_MS      1
+#define A_WINDOW_MS      40
+#define A_WIFI_MS        10
+#define A_RING           512                // samples buffered for loop, power of 2
+
+// Temperature sensor: NTC on A0 or, if SENSOR_MAX6675 is defined, a MAX6675 thermocouple converter
+#define MAX6675_SCK_PIN  D1
+#define MAX6675_CS_PIN   D2
+#define MAX6675_SO_PIN   D6
+#define MAX6675_INTERVAL_MS 250
+
 // NTC parameters and voltage divider resistor
 #define NTC_B            3999
 #define NTC_R_N          100000
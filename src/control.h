@@ -0,0 +1,60 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+// Sensor, converter, pid and output stages of the temperature control loop,
+// composed at compile time. Policies are plain classes (see sensor.h,
+// converter.h, output.h and clock.h), so calls are direct and can be inlined.
+
+#include <stdint.h>
+
+#include "config.h"
+#include "pid.h"
+
+
+template<class Sensor, class Converter, class Output, class Clock>
+class Control {
+public:
+  Sensor sensor;
+  Converter converter;
+  Output output;
+  Clock clock;
+  Pid pid;
+
+  // Start the sensor. Switch off with output.begin() first thing after reset
+  void begin() {
+    sensor.begin();
+  }
+
+  // Update temp_c if the sensor has new samples, returns their number
+  uint32_t measure( double &temp_c ) {
+    uint32_t samples = sensor.read(_raw);
+    if( samples ) {
+      temp_c = converter.celsius(_raw);
+    }
+    return samples;
+  }
+
+  // Every PID_INTERVAL_MS adjust duty to move temp_c toward set_point, returns true if it did
+  bool regulate( const double temp_c, const double set_point, const pid_gains_t gains[], const uint16_t bands, uint16_t &duty ) {
+    uint32_t now = clock.millis();
+    if( now - _prev_regulate <= PID_INTERVAL_MS ) {
+      return false;
+    }
+    _prev_regulate = now;
+
+    duty = Pid::duty(pid.step(now, temp_c, set_point, PID_MIN_ERROR, PID_MAX_SUM, gains, bands));
+    return true;
+  }
+
+  void drive( const unsigned duty ) {
+    output.write(duty);
+  }
+
+  uint32_t raw() const { return _raw; }
+
+private:
+  uint32_t _raw = 0;                // last raw sensor value
+  uint32_t _prev_regulate = 0;      // ms of last pid step
+};
+
+#endif
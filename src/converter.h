@@ -0,0 +1,74 @@
+#ifndef CONVERTER_H
+#define CONVERTER_H
+
+// Converter policies for Control<Sensor, Converter, Output>
+//
+// A converter provides
+//   double celsius( uint32_t raw )    temperature from the sensors raw value
+//   uint32_t value() const            intermediate value of the last conversion, for display
+//   static const char *label()        html label of value()
+//   static const char *unit()         html unit of value()
+
+#include <stdint.h>
+#include <math.h> // for log()
+
+#include "config.h"
+
+
+// NTC with series resistor R_v on A0, raw is the sum of A_SAMPLES analog reads
+class NtcConverter {
+public:
+  // NTC characteristics (datasheet)
+  static const uint32_t B = NTC_B;
+  static const uint32_t R_n = NTC_R_N; // Ohm
+  static const uint32_t T_n = NTC_T_N; // Celsius
+
+  static const uint32_t R_v = NTC_R_V; // Ohm, voltage divider resistor for NTC
+
+  static constexpr double Fail_celsius = 999.9; // open or shorted NTC: read as hot so the oven is switched off
+
+  static const char *label() { return "NTC resistance"; }
+  static const char *unit() { return "&#8486;"; }
+
+  // Resistance of a voltage divider with NTC to ground, then temperature in Celsius
+  double celsius( const uint32_t raw ) {
+    static const uint32_t Max_raw = (uint32_t)A_MAX * A_SAMPLES;
+
+    if( raw == 0 || raw >= Max_raw ) { // shorted or open NTC (or no sensor)
+      _r_ntc = raw ? UINT32_MAX : 0;
+      return Fail_celsius;
+    }
+
+    _r_ntc = (int64_t)R_v * raw / (Max_raw - raw);
+    return celsius_ohm(_r_ntc);
+  }
+
+  static double celsius_ohm( const uint32_t r_ntc ) {
+    return 1.0 / (1.0/(273.15+T_n) + log((double)r_ntc/R_n)/B) - 273.15;
+  }
+
+  uint32_t value() const { return _r_ntc; }
+
+private:
+  uint32_t _r_ntc = 0;              // Ohm, resistance updated with each conversion
+};
+
+
+// MAX6675 already converts, raw is in quarter celsius
+class Max6675Converter {
+public:
+  static const char *label() { return "Thermocouple"; }
+  static const char *unit() { return "/4 &#8451;"; }
+
+  double celsius( const uint32_t raw ) {
+    _raw = raw;
+    return 0.25 * raw;
+  }
+
+  uint32_t value() const { return _raw; }
+
+private:
+  uint32_t _raw = 0;
+};
+
+#endif
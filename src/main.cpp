@@ -13,9 +13,16 @@
 #include <WiFiUdp.h>
 #include <Syslog.h>
 
+#include <EEPROM.h>
+
 #include "config.h"
 
-#include <math.h> // for log()
+#include "control.h"
+#include "clock.h"
+#include "pid.h"
+#include "sensor.h"
+#include "converter.h"
+#include "output.h"
 
 #ifndef VERSION
   #define VERSION   NAME " 2.0 " __DATE__ " " __TIME__
@@ -34,26 +41,25 @@ ESP8266HTTPUpdateServer esp_updater;
 uint16_t _duty = 100;               // ssr pwm percent. Make oven useful without WLAN
 bool _fixed_duty = true;            // true: decouple from temperature control
 
-// Analog read samples
-const uint16_t A_samples = A_SAMPLES;
-const uint16_t A_max = A_MAX;
-uint32_t _a_sum = 0;                // sum of last analog reads
-
-// NTC characteristics (datasheet)
-static const uint32_t B = NTC_B;
-static const uint32_t R_n = NTC_R_N; // Ohm
-static const uint32_t T_n = NTC_T_N; // Celsius
-
-static const uint32_t R_v = NTC_R_V; // Ohm, voltage divider resistor for NTC
+// Temperature control stages, selected at compile time
+#ifdef SENSOR_MAX6675
+  Control<Max6675Sensor, Max6675Converter, SsrOutput, MillisClock> _control;
+#else
+  Control<AnalogSensor, NtcConverter, SsrOutput, MillisClock> _control;
+#endif
 
-uint32_t _r_ntc = 0;                // Ohm, resistance updated with each analog read
-double _temp_c = 0;                 // Celsius, calculated from NTC and R_v
+double _temp_c = 0;                 // Celsius, converted from sensor raw value
 uint16_t _temp_target = 0;          // adjust _duty to reach this temperature
 
-// PID stuff
-double _pid_kp = PID_K_P;
-double _pid_ki = PID_K_I;
-double _pid_kd = PID_K_D;
+// PID stuff, gains in effect are in _control.pid
+pid_gains_t _pid_gains[PID_BANDS] = PID_GAINS; // gain schedule, ascending celsius
+
+// Settings persisted in EEPROM
+typedef struct {
+  uint32_t magic;
+  uint16_t bands;
+  pid_gains_t gains[PID_BANDS];
+} settings_t;
 
 // Temperature history
 int16_t _t[8640];      // 1 day centicelsius temperature history in 10s intervals
@@ -102,7 +108,7 @@ void send_menu( const char *msg ) {
         "<h1>Reflowino Web Remote Control</h1>\n"
         "<p>Control the Reflow Oven</p>\n";
   static const char form[] = "<p>%s</p>\n"
-        "<p>Temperature: %5.1f &#8451;,  NTC resistance: %d &#8486;,  Analog: %d</p>\n"
+        "<p>Temperature: %5.1f &#8451;,  %s: %u %s,  Raw: %u</p>\n"
         "<table><tr>\n"
           "<form action=\"/target\" mode=\"POST\">\n"
             "<td><label for=\"celsius\">Target</label></td><td>%u&#8451;</td>\n"
@@ -114,23 +120,17 @@ void send_menu( const char *msg ) {
             "<td>0%%</td><td colspan=\"2\"><input id=\"percent\", name=\"percent\" type=\"range\" min=\"0\" max=\"100\" value=\"%u\"/></td><td>100%%</td>\n"
             "<td><button>Set</button></td>\n"
           "</form></tr><tr>\n"
-          "<td colspan=\"2\">PID Parameters</td></tr><tr>\n"
-          "<form action=\"/kp\" mode=\"POST\">\n"
-            "<td><label for=\"kp\">Kp</label></td><td>%4.2f</td>\n"
-            "<td>0.00</td><td colspan=\"2\"><input id=\"kp\", name=\"kp\" type=\"range\" min=\"0.00\" max=\"10.00\" step=\"0.01\" value=\"%4.2f\"/></td><td>10.00</td>\n"
-            "<td><button>Set</button></td>\n"
-          "</form></tr><tr>\n"
-          "<form action=\"/ki\" mode=\"POST\">\n"
-            "<td><label for=\"ki\">Ki</label></td><td>%4.2f</td>\n"
-            "<td>0.00</td><td colspan=\"2\"><input id=\"ki\", name=\"ki\" type=\"range\" min=\"0.00\" max=\"10.00\" step=\"0.01\" value=\"%4.2f\"/></td><td>10.00</td>\n"
+          "<td colspan=\"2\">PID Parameters</td><td colspan=\"4\">Kp %4.2f, Ki %4.2f, Kd %4.2f</td></tr>\n";
+  static const char band[] = "<tr>\n"
+          "<form action=\"/gains\" mode=\"POST\">\n"
+            "<input name=\"band\" type=\"hidden\" value=\"%u\"/>\n"
+            "<td><label for=\"celsius%u\">Band</label></td><td><input id=\"celsius%u\" name=\"celsius\" type=\"number\" min=\"0\" max=\"300\" value=\"%u\"/>&#8451;</td>\n"
+            "<td>Kp <input name=\"kp\" type=\"number\" min=\"0.00\" max=\"10.00\" step=\"0.01\" value=\"%4.2f\"/></td>\n"
+            "<td>Ki <input name=\"ki\" type=\"number\" min=\"0.00\" max=\"10.00\" step=\"0.01\" value=\"%4.2f\"/></td>\n"
+            "<td>Kd <input name=\"kd\" type=\"number\" min=\"0.00\" max=\"10.00\" step=\"0.01\" value=\"%4.2f\"/></td>\n"
             "<td><button>Set</button></td>\n"
-          "</form></tr><tr>\n"
-          "<form action=\"/kd\" mode=\"POST\">\n"
-            "<td><label for=\"kd\">Kd</label></td><td>%4.2f</td>\n"
-            "<td>0.00</td><td colspan=\"2\"><input id=\"kd\", name=\"kd\" type=\"range\" min=\"0.00\" max=\"10.00\" step=\"0.01\" value=\"%4.2f\"/></td><td>10.00</td>\n"
-            "<td><button>Set</button></td>\n"
-          "</form></tr><tr><td>\n";
-  static const char footer[] =
+          "</form></tr>\n";
+  static const char footer[] = "<tr><td>\n"
           "<form action=\"/on\" mode=\"POST\">\n"
             "<button>ON</button>\n"
           "</form></td><td>\n"
@@ -146,15 +146,29 @@ void send_menu( const char *msg ) {
         "</table>\n"
       "</body>\n"
     "</html>\n";
-  static char page[sizeof(form)+100]; // form + variables
+  static char page[sizeof(form)+160]; // form + variables (msg up to 80, label and unit up to 30)
+  static char bands[PID_BANDS*(sizeof(band)+40)]; // band rows + variables
 
+  // Content length from what was written: snprintf returns the untruncated length
   size_t len = sizeof(header) + sizeof(footer) - 2;
-  len += snprintf(page, sizeof(page), form, msg, _temp_c, _r_ntc, _a_sum, 
-    _temp_target, _temp_target, _duty, _duty, _pid_kp, _pid_kp, _pid_ki, _pid_ki, _pid_kd, _pid_kd);
+  snprintf(page, sizeof(page), form, msg, _temp_c, 
+    _control.converter.label(), _control.converter.value(), _control.converter.unit(), _control.raw(),
+    _temp_target, _temp_target, _duty, _duty, _control.pid.kp, _control.pid.ki, _control.pid.kd);
+  len += strlen(page);
+
+  size_t bands_len = 0;
+  for( unsigned b = 0; b < PID_BANDS; b++ ) {
+    const pid_gains_t &g = _pid_gains[b];
+    snprintf(bands + bands_len, sizeof(bands) - bands_len, band, 
+      b, b, b, g.celsius, g.kp, g.ki, g.kd);
+    bands_len += strlen(bands + bands_len);
+  }
+  len += bands_len;
 
   web_server.setContentLength(len);
   web_server.send(200, "text/html", header);
   web_server.sendContent(page);
+  web_server.sendContent(bands);
   web_server.sendContent(footer);
 }
 
@@ -169,6 +183,44 @@ void setup_Wifi() {
 }
 
 
+// Check gain schedule: gains within slider range and band temperatures strictly ascending
+bool validGains( const pid_gains_t gains[], const uint16_t bands ) {
+  for( uint16_t b = 0; b < bands; b++ ) {
+    const pid_gains_t &g = gains[b];
+    if( !(g.kp >= 0.0 && g.kp <= 10.0) || !(g.ki >= 0.0 && g.ki <= 10.0) || !(g.kd >= 0.0 && g.kd <= 10.0) ) {
+      return false;
+    }
+    if( g.celsius > 300 || (b > 0 && g.celsius <= gains[b-1].celsius) ) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+// Restore gain schedule from EEPROM if it was saved with the same layout
+bool loadGains( pid_gains_t gains[], const uint16_t bands ) {
+  settings_t settings;
+  EEPROM.get(0, settings);
+  if( settings.magic != EEPROM_MAGIC || settings.bands != bands || !validGains(settings.gains, bands) ) {
+    return false; // keep defaults
+  }
+  memcpy(gains, settings.gains, sizeof(settings.gains));
+  return true;
+}
+
+
+// Persist gain schedule in EEPROM (flash, so only on explicit change)
+bool saveGains( const pid_gains_t gains[], const uint16_t bands ) {
+  settings_t settings;
+  settings.magic = EEPROM_MAGIC;
+  settings.bands = bands;
+  memcpy(settings.gains, gains, sizeof(settings.gains));
+  EEPROM.put(0, settings);
+  return EEPROM.commit();
+}
+
+
 // Define web pages for update, reset or for configuring parameters
 void setup_Webserver() {
 
@@ -228,6 +280,7 @@ void setup_Webserver() {
       long c = web_server.arg("celsius").toInt();
       if( c >= 0 && c <= 300 ) {
         _temp_target = (uint16_t)c;
+        _control.pid.schedule(_temp_target, _pid_gains, PID_BANDS);
         if( _temp_target == 0 ) {
           _duty = 0;
           _fixed_duty = true;
@@ -249,64 +302,40 @@ void setup_Webserver() {
     syslog.logf(LOG_NOTICE, "TARGET %u", _temp_target);
   });
 
-  // Set pid Kp
-  web_server.on("/kp", []() {
-    if( web_server.arg("kp") != "" ) {
-      double kp = web_server.arg("kp").toDouble();
-      if( kp >= 0.0 && kp <= 10.0 ) {
-        _pid_kp = kp; // TODO: store in EPROM
-        char msg[40];
-        snprintf(msg, sizeof(msg), "Set Kp: %5.2f", _pid_kp);
-        send_menu(msg);
-      }
-      else {
-        send_menu("ERROR: Set Kp out of range (0.0-10.0)");
-      }
-    }
-    else {
-      send_menu("ERROR: Kp without value");
-    }
-    syslog.logf(LOG_NOTICE, "Kp %5.2f", _pid_kp);
-  });
-
-  // Set pid Ki
-  web_server.on("/ki", []() {
-    if( web_server.arg("ki") != "" ) {
-      double ki = web_server.arg("ki").toDouble();
-      if( ki >= 0.0 && ki <= 10.0 ) {
-        _pid_ki = ki; // TODO: store in EPROM
-        char msg[40];
-        snprintf(msg, sizeof(msg), "Set Ki: %5.2f", _pid_ki);
-        send_menu(msg);
-      }
-      else {
-        send_menu("ERROR: Set Ki out of range (0.0-10.0)");
-      }
-    }
-    else {
-      send_menu("ERROR: Ki without value");
-    }
-    syslog.logf(LOG_NOTICE, "Ki %5.2f", _pid_ki);
-  });
-
-  // Set pid Kd
-  web_server.on("/kd", []() {
-    if( web_server.arg("kd") != "" ) {
-      double kd = web_server.arg("kd").toDouble();
-      if( kd >= 0.0 && kd <= 10.0 ) {
-        _pid_kd = kd; // TODO: store in EPROM
-        char msg[40];
-        snprintf(msg, sizeof(msg), "Set Kd: %5.2f", _pid_kd);
-        send_menu(msg);
+  // Set pid gains of one band of the gain schedule and persist them
+  web_server.on("/gains", []() {
+    if( web_server.arg("band") != "" && web_server.arg("celsius") != "" 
+     && web_server.arg("kp") != "" && web_server.arg("ki") != "" && web_server.arg("kd") != "" ) {
+      long b = web_server.arg("band").toInt();
+      long c = web_server.arg("celsius").toInt();
+      if( b >= 0 && b < PID_BANDS && c >= 0 && c <= 300 ) {
+        pid_gains_t gains[PID_BANDS];
+        memcpy(gains, _pid_gains, sizeof(gains));
+        gains[b].celsius = (uint16_t)c;
+        gains[b].kp = web_server.arg("kp").toDouble();
+        gains[b].ki = web_server.arg("ki").toDouble();
+        gains[b].kd = web_server.arg("kd").toDouble();
+        if( validGains(gains, PID_BANDS) ) {
+          memcpy(_pid_gains, gains, sizeof(gains));
+          _control.pid.schedule(_temp_target, _pid_gains, PID_BANDS);
+          bool saved = saveGains(_pid_gains, PID_BANDS);
+          char msg[80];
+          snprintf(msg, sizeof(msg), "Set band %ld: %u&#8451; Kp %4.2f Ki %4.2f Kd %4.2f%s", b, 
+            gains[b].celsius, gains[b].kp, gains[b].ki, gains[b].kd, saved ? "" : " (not saved)");
+          send_menu(msg);
+          syslog.logf(LOG_NOTICE, "GAINS %ld: %u %5.2f %5.2f %5.2f", b, gains[b].celsius, gains[b].kp, gains[b].ki, gains[b].kd);
+        }
+        else {
+          send_menu("ERROR: Set gains out of range (0.0-10.0) or band celsius not ascending");
+        }
       }
       else {
-        send_menu("ERROR: Set Kd out of range (0.0-10.0)");
+        send_menu("ERROR: Set band or celsius out of range (0-300)");
       }
     }
     else {
-      send_menu("ERROR: Kd without value");
+      send_menu("ERROR: Gains without band, celsius, kp, ki or kd");
     }
-    syslog.logf(LOG_NOTICE, "Kd %5.2f", _pid_kd);
   });
 
   // Call this page to see the ESPs firmware version
@@ -343,7 +372,7 @@ void setup_Webserver() {
   // Catch all page, gives a hint on valid URLs
   web_server.onNotFound([]() {
     web_server.send(404, "text/plain", "error: use "
-      "/on, /off, /reset, /version, /temperature, /history.bin, /duty, /target or "
+      "/on, /off, /reset, /version, /temperature, /history.bin, /duty, /target, /gains or "
       "post image to /update\n");
   });
 
@@ -396,83 +425,18 @@ void handleWifi() {
 }
 
 
-void handleDuty( const unsigned duty ) {
-  static bool state = LOW;
-  static uint32_t since = 0;
-
-  uint32_t now = millis();
-  if( (now - since) >= DUTY_CYCLE_MS ) {
-    since = now;
-  }
-
-  if( (now - since) >= (((uint32_t)duty * DUTY_CYCLE_MS) / 100) ) {
-    if( state == HIGH ) {
-      state = LOW;
-      digitalWrite(SWITCH_PIN, state);
-    }
-  }
-  else {
-    if( state == LOW ) {
-      state = HIGH;
-      digitalWrite(SWITCH_PIN, state);
-    }
-  }
-}
-
-
-void handleControl( const double control, uint16_t &duty ) {
-  if( control <= 0 ) {
-    duty = 0;
-  }
-  else if( control >= 100 ) {
-    duty = 100;
-  }
-  else {
-    duty = (uint16_t)(control + 0.5); 
-  }
-}
-
-
-// Hint: make sure the physical relation between control_variable and current_value is as linear as possible
-void handlePid( const double current_value, const double set_point, const double min_error, const double max_sum, double &control_variable ) {
-  static double error_sum = 0;
-  static uint32_t prev_time = 0;
-
-  double error = set_point - current_value;
-
-  if( (error > 0 && error > min_error) || (error < 0 && error < -min_error) ) { // ignore minimal deviations (probably noise)
-    uint32_t now = millis();
-    double delta_t = 0.001 * (now - prev_time);
-    prev_time = now;
-    if( delta_t > 1 ) { // long time no see:
-      error_sum = 0;    // ...better start over without wind up
-      control_variable = 0;
-    }
-    else {
-      control_variable = _pid_kp * error;
-      if( delta_t > 0 ) { // ignore zero time delta if called too fast
-        if( (error > 0 && _pid_ki * error_sum < max_sum) || (error < 0 && _pid_ki * error_sum > -max_sum) ) { // limit wind up
-          error_sum += error * delta_t;
-        }
-        control_variable += _pid_ki * error_sum + _pid_kd * error / delta_t;
-      }
-    }
-  }
-}
-
-
 void print_temperature_table() {
   const uint32_t rv_10k  = 10000;
   const uint32_t rv_100k = 100000;
   double t_10k_prev  = 0.0;
   double t_100k_prev = 0.0;
 
-  for( uint16_t a = 0; a < A_max; a++ ) {
-    uint32_t r_ntc_v10k  = rv_10k  * a / (A_max - a);
-    uint32_t r_ntc_v100k = rv_100k * a / (A_max - a);
+  for( uint16_t a = 0; a < A_MAX; a++ ) {
+    uint32_t r_ntc_v10k  = rv_10k  * a / (A_MAX - a);
+    uint32_t r_ntc_v100k = rv_100k * a / (A_MAX - a);
 
-    double t_10k  = 1.0 / (1.0/(273.15+T_n) + log((double)r_ntc_v10k /R_n)/B) - 273.15;
-    double t_100k = 1.0 / (1.0/(273.15+T_n) + log((double)r_ntc_v100k/R_n)/B) - 273.15;
+    double t_10k  = NtcConverter::celsius_ohm(r_ntc_v10k);
+    double t_100k = NtcConverter::celsius_ohm(r_ntc_v100k);
 
     Serial.printf("%4u: t10= %5.1f t10diff= %5.1f t100diff= %5.1f t100= %5.1f\n", 
       a, t_10k, t_10k-t_10k_prev, t_100k-t_100k_prev, t_100k);
@@ -511,72 +475,15 @@ void simulate_temp( double &temp_c ) {
 }
 
 
-void updateTemperature( const uint32_t r_ntc, double &temp_c ) {
-  // only print if measurement decimals change 
-  static int16_t t_prev = 0;
-
-  // if( _fixed_duty ) {
-  temp_c = 1.0 / (1.0/(273.15+T_n) + log((double)r_ntc/R_n)/B) - 273.15;
-  // }
-  // else {
-  //   simulate_temp(temp_c);
-  // }
-
-  int16_t temp = (int16_t)(temp_c * 100 + 0.5); // rounded centi celsius
-  if( (temp - t_prev) * (temp - t_prev) >= 10 * 10 ) { // only report changes >= 0.1
-    // Serial.printf("Temperature: %01d.%01d degree Celsius\n", temp/100, (temp/10)%10);
-    t_prev = temp;
-  }
-}
-
-
-void updateResistance( const uint32_t a_sum, uint32_t &r_ntc, double &temp_c ) {
-  static const uint32_t Max_sum = (uint32_t)A_max * A_samples;
-
-  r_ntc = (int64_t)R_v * a_sum / (Max_sum - a_sum);
-
-  updateTemperature(r_ntc, temp_c);
-}
-
-
-void handleAnalog( uint32_t &a_sum, uint32_t &r_ntc, double &temp_c ) {
-  static uint16_t a[A_samples] = { 0 }; // last analog reads
-  static uint16_t a_pos = A_samples;    // sample index
-
-  if( millis() % 40 > 10 ) { // now and then release analog for wifi
-    int value = analogRead(A0);
-
-    // first time init
-    if( a_pos == A_samples ) {
-      while( a_pos-- ) {
-        a[a_pos] = (uint16_t)value;
-        a_sum += (uint32_t)value;
-      }
-    }
-    else {
-      if( ++a_pos >= A_samples ) {
-        a_pos = 0;
-      }
-
-      a_sum -= a[a_pos];
-      a[a_pos] = (uint16_t)value;
-      a_sum += a[a_pos];
-    }
-
-    updateResistance(a_sum, r_ntc, temp_c);
-  }
-}
-
-
-void handleFrequency() {
+void handleFrequency( const uint32_t samples ) {
   static uint32_t start = 0;
   static uint32_t count = 0;
 
-  count++;
+  count += samples;
 
   uint32_t now = millis();
   if( now - start > 1000 ) {
-    printf("Measuring analog at %u Hz\n", count);
+    Serial.printf("Measuring sensor at %u Hz, %u overruns\n", count, _control.sensor.overruns());
     start = now;
     count = 0;
   }
@@ -605,8 +512,7 @@ void handleTempHistory( const double temp_c, int16_t t[], const uint16_t t_entri
 
 void setup() {
   // start with switch off:
-  pinMode(SWITCH_PIN, OUTPUT);
-  digitalWrite(SWITCH_PIN, LOW);
+  _control.output.begin();
 
   Serial.begin(115200);
 
@@ -619,6 +525,13 @@ void setup() {
   syslog.appName("Joba1");
   syslog.defaultPriority(LOG_KERN);
 
+  // Restore persisted settings
+  EEPROM.begin(sizeof(settings_t));
+  if( !loadGains(_pid_gains, PID_BANDS) ) {
+    Serial.println("No valid PID gains in EEPROM, using defaults");
+  }
+  _control.pid.schedule(_temp_target, _pid_gains, PID_BANDS);
+
   // Init the neopixels
   pixels.begin();
   pixels.setBrightness(255);
@@ -635,32 +548,29 @@ void setup() {
 
   // print_temperature_table();
 
+  // Start measuring (switch is already off)
+  _control.begin();
+
   Serial.println("\nBooted " VERSION);
 }
 
 
 void loop() {
-  // handleFrequency();
-  handleAnalog(_a_sum, _r_ntc, _temp_c);
+  // handleFrequency(_control.measure(_temp_c));
+  _control.measure(_temp_c);
   handleTempHistory(_temp_c, _t, sizeof(_t)/sizeof(*_t), _t_pos);
 
-  static uint32_t prev = 0;
   static uint16_t count = 0;
-  uint32_t now = millis();
-  if( (_temp_target && !_fixed_duty) && (now - prev > 100) ) {
-    double control;
-    handlePid(_temp_c, _temp_target, 0.2, 100, control);
-    handleControl(control, _duty);
+  if( (_temp_target && !_fixed_duty) && _control.regulate(_temp_c, _temp_target, _pid_gains, PID_BANDS, _duty) ) {
     char msg[80];
-    snprintf(msg, sizeof(msg), "Temp=%5.1f, Set=%3u, Control=%5.1f, Duty=%3u", _temp_c, _temp_target, control, _duty);
+    snprintf(msg, sizeof(msg), "Temp=%5.1f, Set=%3u, Control=%5.1f, Duty=%3u", _temp_c, _temp_target, _control.pid.control, _duty);
     Serial.println(msg);
     if( count-- == 0 ) {
       syslog.log(LOG_INFO, msg);
       count = 100;
     }
-    prev = now;
   }
-  handleDuty(_duty);
+  _control.drive(_duty);
   handleWifi();
   delay(1);
 }
\ No newline at end of file
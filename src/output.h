@@ -0,0 +1,48 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+// Output policies for Control<Sensor, Converter, Output>
+//
+// An output provides
+//   void begin()                      switch off
+//   void write( unsigned duty )       apply duty percent, called each loop
+
+#include <Arduino.h>
+
+#include "config.h"
+
+
+// Solid state relay on SWITCH_PIN, slow pwm with DUTY_CYCLE_MS period
+class SsrOutput {
+public:
+  void begin() {
+    pinMode(SWITCH_PIN, OUTPUT);
+    digitalWrite(SWITCH_PIN, LOW);
+  }
+
+  void write( const unsigned duty ) {
+    uint32_t now = millis();
+    if( (now - _since) >= DUTY_CYCLE_MS ) {
+      _since = now;
+    }
+
+    if( (now - _since) >= (((uint32_t)duty * DUTY_CYCLE_MS) / 100) ) {
+      if( _state == HIGH ) {
+        _state = LOW;
+        digitalWrite(SWITCH_PIN, _state);
+      }
+    }
+    else {
+      if( _state == LOW ) {
+        _state = HIGH;
+        digitalWrite(SWITCH_PIN, _state);
+      }
+    }
+  }
+
+private:
+  bool _state = LOW;
+  uint32_t _since = 0;
+};
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef PID_H
+#define PID_H
+
+// PID with gains scheduled by set point, used by Control::regulate()
+
+#include <stdint.h>
+
+
+typedef struct {
+  uint16_t celsius;                 // set point where these gains apply unmodified
+  double kp, ki, kd;
+} pid_gains_t;
+
+
+// Hint: make sure the physical relation between control and current_value is as linear as possible
+class Pid {
+public:
+  double kp = 0, ki = 0, kd = 0;    // gains in effect, interpolated from the schedule
+  double control = 0;               // control variable of the last step
+
+  // Interpolate gains linearly between the bands around set_point, clamp outside the schedule
+  void schedule( const double set_point, const pid_gains_t gains[], const uint16_t bands ) {
+    uint16_t hi = 0;
+    while( hi < bands && gains[hi].celsius < set_point ) {
+      hi++;
+    }
+
+    if( hi == 0 || hi == bands ) {
+      const pid_gains_t &g = gains[hi ? bands - 1 : 0];
+      kp = g.kp;
+      ki = g.ki;
+      kd = g.kd;
+    }
+    else {
+      const pid_gains_t &l = gains[hi - 1];
+      const pid_gains_t &h = gains[hi];
+      double f = (set_point - l.celsius) / (h.celsius - l.celsius);
+      kp = l.kp + f * (h.kp - l.kp);
+      ki = l.ki + f * (h.ki - l.ki);
+      kd = l.kd + f * (h.kd - l.kd);
+    }
+  }
+
+  // One pid step at time now (ms) with gains scheduled for set_point, returns control
+  double step( const uint32_t now, const double current_value, const double set_point, const double min_error, const double max_sum,
+      const pid_gains_t gains[], const uint16_t bands ) {
+    schedule(set_point, gains, bands);
+
+    double error = set_point - current_value;
+
+    if( (error > 0 && error > min_error) || (error < 0 && error < -min_error) ) { // ignore minimal deviations (probably noise)
+      double delta_t = 0.001 * (now - _prev_time);
+      _prev_time = now;
+      if( delta_t > 1 ) { // long time no see:
+        _i_term = 0;      // ...better start over without wind up
+        control = 0;
+      }
+      else {
+        control = kp * error;
+        if( delta_t > 0 ) { // ignore zero time delta if called too fast
+          if( (error > 0 && _i_term < max_sum) || (error < 0 && _i_term > -max_sum) ) { // limit wind up
+            _i_term += ki * error * delta_t;
+          }
+          control += _i_term + kd * error / delta_t;
+        }
+      }
+    }
+    return control;
+  }
+
+  // Control variable as duty percent
+  static uint16_t duty( const double control ) {
+    if( control <= 0 ) {
+      return 0;
+    }
+    if( control >= 100 ) {
+      return 100;
+    }
+    return (uint16_t)(control + 0.5);
+  }
+
+private:
+  double _i_term = 0;               // integral part, summed with the ki of its time: no bump if ki changes
+  uint32_t _prev_time = 0;          // ms of last step
+};
+
+#endif
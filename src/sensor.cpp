@@ -0,0 +1,130 @@
+#include "sensor.h"
+
+#include <Ticker.h>
+
+
+// Analog samples from ticker to AnalogSensor::read(): lock-free single producer, single consumer ring
+static const uint16_t A_ring = A_RING;
+static_assert((A_ring & (A_ring - 1)) == 0, "A_RING must be a power of 2");
+static volatile uint16_t _a_ring[A_ring];
+static volatile uint32_t _a_head = 0;     // free running, written by ticker only
+static volatile uint32_t _a_tail = 0;     // free running, written by loop only
+static volatile uint32_t _a_overruns = 0; // samples lost: ring full or ticks missed by a busy loop
+
+static Ticker _a_ticker;
+
+
+// Ticker callback: sample A0 every A_SAMPLE_MS, but leave it to WIFI for A_WIFI_MS of every A_WINDOW_MS.
+// Runs as os_timer callback in the SDK task context, not as isr: never in the middle of loop(),
+// the WIFI stack or a flash access, so analogRead() may run from flash.
+// A loop() pass that does not yield for longer than A_SAMPLE_MS delays ticks, counted as overruns.
+static void onAnalogTick() {
+  static uint32_t prev = 0;
+  uint32_t now = millis();
+
+  if( prev != 0 && now - prev > A_SAMPLE_MS ) {
+    _a_overruns += (now - prev) / A_SAMPLE_MS - 1;
+  }
+  prev = now;
+
+  if( now % A_WINDOW_MS >= A_WIFI_MS ) {
+    uint32_t head = _a_head;
+    if( head - _a_tail < A_ring ) {
+      _a_ring[head & (A_ring - 1)] = (uint16_t)analogRead(A0);
+      _a_head = head + 1;
+    }
+    else {
+      _a_overruns++;
+    }
+  }
+}
+
+
+void AnalogSensor::begin() {
+  _a_ticker.attach_ms(A_SAMPLE_MS, onAnalogTick);
+}
+
+
+// Drain sampled values from the ring in one batch into the moving sum
+uint32_t AnalogSensor::read( uint32_t &raw ) {
+  uint32_t head = _a_head;
+  uint32_t tail = _a_tail;
+  uint32_t count = head - tail;
+
+  if( count == 0 ) {
+    return 0;
+  }
+
+  while( tail != head ) {
+    uint16_t value = _a_ring[tail & (A_ring - 1)];
+    tail++;
+
+    // first time init
+    if( _a_pos == A_SAMPLES ) {
+      while( _a_pos-- ) {
+        _a[_a_pos] = value;
+        _a_sum += (uint32_t)value;
+      }
+    }
+    else {
+      if( ++_a_pos >= A_SAMPLES ) {
+        _a_pos = 0;
+      }
+
+      _a_sum -= _a[_a_pos];
+      _a[_a_pos] = value;
+      _a_sum += _a[_a_pos];
+    }
+  }
+  _a_tail = tail; // release the slots to the isr
+
+  raw = _a_sum;
+  return count;
+}
+
+
+uint32_t AnalogSensor::overruns() const {
+  return _a_overruns;
+}
+
+
+void Max6675Sensor::begin() {
+  pinMode(MAX6675_CS_PIN, OUTPUT);
+  digitalWrite(MAX6675_CS_PIN, HIGH);
+  pinMode(MAX6675_SCK_PIN, OUTPUT);
+  digitalWrite(MAX6675_SCK_PIN, LOW);
+  pinMode(MAX6675_SO_PIN, INPUT);
+  _since = millis();
+}
+
+
+// Read one conversion if the chip had time for it (max 220ms)
+uint32_t Max6675Sensor::read( uint32_t &raw ) {
+  uint32_t now = millis();
+  if( (now - _since) < MAX6675_INTERVAL_MS ) {
+    return 0;
+  }
+  _since = now;
+
+  // Falling CS stops conversion and outputs D15 (dummy sign bit) first
+  uint16_t value = 0;
+  digitalWrite(MAX6675_CS_PIN, LOW);
+  delayMicroseconds(1);
+  for( uint8_t bit = 0; bit < 16; bit++ ) {
+    digitalWrite(MAX6675_SCK_PIN, LOW);
+    delayMicroseconds(1);
+    value = (value << 1) | (digitalRead(MAX6675_SO_PIN) ? 1 : 0);
+    digitalWrite(MAX6675_SCK_PIN, HIGH);
+    delayMicroseconds(1);
+  }
+  digitalWrite(MAX6675_SCK_PIN, LOW);
+  digitalWrite(MAX6675_CS_PIN, HIGH); // start next conversion
+
+  if( value & 0x4 ) {
+    raw = Max_raw; // open thermocouple: read as hot as possible so the oven is switched off
+  }
+  else {
+    raw = value >> 3;
+  }
+  return 1;
+}
@@ -0,0 +1,46 @@
+#ifndef SENSOR_H
+#define SENSOR_H
+
+// Sensor policies for Control<Sensor, Converter, Output>
+//
+// A sensor provides
+//   void begin()                      start measuring
+//   uint32_t read( uint32_t &raw )    number of new samples since last read, raw value for the converter
+//   uint32_t overruns() const         samples lost since boot
+
+#include <Arduino.h>
+
+#include "config.h"
+
+
+// NTC voltage divider on A0, sampled by a ticker on a fixed schedule.
+// raw is the sum of the last A_SAMPLES analog reads (0...A_MAX*A_SAMPLES)
+// Only one instance: the sample ring is shared with the ticker callback
+class AnalogSensor {
+public:
+  void begin();
+  uint32_t read( uint32_t &raw );
+  uint32_t overruns() const;
+
+private:
+  uint16_t _a[A_SAMPLES];           // last analog reads
+  uint16_t _a_pos = A_SAMPLES;      // sample index, A_SAMPLES until first read
+  uint32_t _a_sum = 0;              // sum of last analog reads
+};
+
+
+// MAX6675 thermocouple converter, bit banged SPI.
+// raw is the temperature in quarter celsius (0...4095). An open thermocouple reads as 4095
+class Max6675Sensor {
+public:
+  static const uint32_t Max_raw = 4095;
+
+  void begin();
+  uint32_t read( uint32_t &raw );
+  uint32_t overruns() const { return 0; }
+
+private:
+  uint32_t _since = 0;              // millis of last read
+};
+
+#endif
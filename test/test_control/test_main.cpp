@@ -0,0 +1,292 @@
+// Host tests of the control loop with mock policies: pio test -e native
+
+#include <unity.h>
+
+#include "control.h"
+#include "converter.h"
+
+
+// Delivers pending samples on the next read
+class MockSensor {
+public:
+  uint32_t pending = 0;             // samples delivered by next read()
+  uint32_t next_raw = 0;
+
+  void begin() {}
+  uint32_t read( uint32_t &raw ) {
+    uint32_t samples = pending;
+    if( samples ) {
+      raw = next_raw;
+      pending = 0;
+    }
+    return samples;
+  }
+};
+
+
+// Tenth celsius, counts conversions
+class MockConverter {
+public:
+  unsigned calls = 0;
+
+  double celsius( const uint32_t raw ) {
+    calls++;
+    return 0.1 * raw;
+  }
+};
+
+
+// Remembers the last duty
+class MockOutput {
+public:
+  unsigned writes = 0;
+  unsigned duty = 0;
+
+  void begin() {}
+  void write( const unsigned d ) {
+    writes++;
+    duty = d;
+  }
+};
+
+
+// Fixed time, set by the test
+class MockClock {
+public:
+  uint32_t now = 0;
+
+  uint32_t millis() const { return now; }
+};
+
+
+typedef Control<MockSensor, MockConverter, MockOutput, MockClock> MockControl;
+
+
+// Simulated oven: full duty heats 1.9 C/s, losses grow with temperature above 25 C
+struct Oven {
+  uint32_t now = 0;                 // ms
+  double temp_c = 25;
+  unsigned duty = 0;
+
+  void advance( const uint32_t ms ) {
+    temp_c += (1.9 * duty / 100 - 0.0069 * (temp_c - 25)) * 0.001 * ms;
+    now += ms;
+  }
+} _oven;
+
+
+class OvenSensor {
+public:
+  void begin() {}
+  uint32_t read( uint32_t &raw ) {
+    raw = (uint32_t)(_oven.temp_c * 10 + 0.5); // tenth celsius for MockConverter
+    return 1;
+  }
+};
+
+
+class OvenOutput {
+public:
+  void begin() {}
+  void write( const unsigned duty ) { _oven.duty = duty; }
+};
+
+
+class OvenClock {
+public:
+  uint32_t millis() const { return _oven.now; }
+};
+
+
+typedef Control<OvenSensor, MockConverter, OvenOutput, OvenClock> OvenControl;
+
+
+// Same steps as loop() in main.cpp, in 10ms slices of oven time
+void run( OvenControl &control, const double set_point, const pid_gains_t gains[], const uint16_t bands, const uint32_t ms ) {
+  static double temp_c = 0;
+  static uint16_t duty = 0;
+  uint32_t end = _oven.now + ms;
+  while( _oven.now < end ) {
+    control.measure(temp_c);
+    control.regulate(temp_c, set_point, gains, bands, duty);
+    control.drive(duty);
+    _oven.advance(10);
+  }
+}
+
+
+const pid_gains_t Gains[] = { {  50, 0.6, 0.1, 0.8 },
+                              { 150, 1.0, 0.2, 1.2 },
+                              { 240, 2.0, 0.4, 1.6 } };
+const uint16_t Bands = sizeof(Gains) / sizeof(*Gains);
+
+
+void setUp() {
+  _oven = Oven();
+}
+
+void tearDown() {}
+
+
+void test_measure_without_samples_keeps_temperature() {
+  MockControl control;
+  double temp_c = 42.0;
+  TEST_ASSERT_EQUAL_UINT32(0, control.measure(temp_c));
+  TEST_ASSERT_EQUAL_FLOAT(42.0, temp_c);
+  TEST_ASSERT_EQUAL_UINT(0, control.converter.calls);
+}
+
+
+void test_measure_converts_once_per_batch() {
+  MockControl control;
+  double temp_c = 0;
+  control.sensor.pending = 17;
+  control.sensor.next_raw = 2315;
+  TEST_ASSERT_EQUAL_UINT32(17, control.measure(temp_c));
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 231.5, temp_c);
+  TEST_ASSERT_EQUAL_UINT32(2315, control.raw());
+  TEST_ASSERT_EQUAL_UINT(1, control.converter.calls);
+
+  TEST_ASSERT_EQUAL_UINT32(0, control.measure(temp_c));
+  TEST_ASSERT_EQUAL_UINT(1, control.converter.calls);
+}
+
+
+void test_drive_writes_duty() {
+  MockControl control;
+  control.drive(35);
+  control.drive(100);
+  TEST_ASSERT_EQUAL_UINT(2, control.output.writes);
+  TEST_ASSERT_EQUAL_UINT(100, control.output.duty);
+}
+
+
+void test_regulate_every_interval() {
+  MockControl control;
+  uint16_t duty = 7;
+  control.clock.now = PID_INTERVAL_MS;
+  TEST_ASSERT_FALSE(control.regulate(25, 150, Gains, Bands, duty));
+  TEST_ASSERT_EQUAL_UINT(7, duty);
+  control.clock.now = PID_INTERVAL_MS + 1;
+  TEST_ASSERT_TRUE(control.regulate(25, 150, Gains, Bands, duty));
+  TEST_ASSERT_EQUAL_UINT(100, duty);
+  TEST_ASSERT_FALSE(control.regulate(25, 150, Gains, Bands, duty));
+}
+
+
+void test_duty_is_clamped_control() {
+  TEST_ASSERT_EQUAL_UINT(0, Pid::duty(-12.0));
+  TEST_ASSERT_EQUAL_UINT(42, Pid::duty(42.4));
+  TEST_ASSERT_EQUAL_UINT(43, Pid::duty(42.5));
+  TEST_ASSERT_EQUAL_UINT(100, Pid::duty(250.0));
+}
+
+
+void test_gains_interpolate_between_bands() {
+  Pid pid;
+  pid.schedule(100, Gains, Bands);
+  TEST_ASSERT_FLOAT_WITHIN(1e-6, 0.8, pid.kp);
+  TEST_ASSERT_FLOAT_WITHIN(1e-6, 0.15, pid.ki);
+  TEST_ASSERT_FLOAT_WITHIN(1e-6, 1.0, pid.kd);
+
+  pid.schedule(150, Gains, Bands);
+  TEST_ASSERT_FLOAT_WITHIN(1e-6, 1.0, pid.kp);
+
+  pid.schedule(20, Gains, Bands);  // below schedule
+  TEST_ASSERT_FLOAT_WITHIN(1e-6, 0.6, pid.kp);
+
+  pid.schedule(300, Gains, Bands); // above schedule
+  TEST_ASSERT_FLOAT_WITHIN(1e-6, 2.0, pid.kp);
+}
+
+
+void test_ki_change_is_bumpless() {
+  pid_gains_t gains[] = { { 100, 0.5, 0.1, 0.0 } };
+  Pid pid;
+  uint32_t now = 0;
+  for( int i = 0; i < 20; i++ ) { // constant error 10 builds up the integral part
+    now += 100;
+    pid.step(now, 100, 110, 0.2, 100, gains, 1);
+  }
+  double before = pid.control;
+
+  gains[0].ki = 0.5;
+  now += 100;
+  double after = pid.step(now, 100, 110, 0.2, 100, gains, 1);
+
+  // Only the new integral increment ki * error * dt is added, the sum so far is kept
+  TEST_ASSERT_FLOAT_WITHIN(1e-6, 0.5 * 10 * 0.1, after - before);
+}
+
+
+void test_closed_loop_reaches_set_point() {
+  OvenControl control;
+  control.begin();
+
+  run(control, 150, Gains, Bands, 1000);
+  TEST_ASSERT_EQUAL_UINT(100, _oven.duty); // far below: full power
+
+  run(control, 150, Gains, Bands, 15 * 60 * 1000UL);
+  TEST_ASSERT_FLOAT_WITHIN(5.0, 150, _oven.temp_c); // limit cycle of a few degrees
+  TEST_ASSERT_TRUE(_oven.duty > 0 && _oven.duty < 100); // holding, not saturated
+  TEST_ASSERT_FLOAT_WITHIN(1e-6, 1.0, control.pid.kp); // band gains at 150
+}
+
+
+void test_closed_loop_follows_set_point_down() {
+  OvenControl control;
+  control.begin();
+
+  run(control, 200, Gains, Bands, 15 * 60 * 1000UL);
+  TEST_ASSERT_FLOAT_WITHIN(5.0, 200, _oven.temp_c); // limit cycle of a few degrees
+
+  run(control, 100, Gains, Bands, 1000);
+  TEST_ASSERT_EQUAL_UINT(0, _oven.duty); // far above: off
+
+  run(control, 100, Gains, Bands, 30 * 60 * 1000UL);
+  TEST_ASSERT_FLOAT_WITHIN(5.0, 100, _oven.temp_c); // limit cycle of a few degrees
+}
+
+
+void test_ntc_converter_at_nominal_resistance() {
+  NtcConverter converter;
+  // Divider gives R_n when raw / max_raw = R_n / (R_n + R_v)
+  uint32_t raw = (uint64_t)A_MAX * A_SAMPLES * NTC_R_N / (NTC_R_N + NTC_R_V);
+  TEST_ASSERT_FLOAT_WITHIN(0.01, NTC_T_N, converter.celsius(raw));
+  TEST_ASSERT_UINT32_WITHIN(1, NTC_R_N, converter.value());
+}
+
+
+void test_ntc_converter_fails_hot() {
+  NtcConverter converter;
+  uint32_t max_raw = (uint32_t)A_MAX * A_SAMPLES;
+  TEST_ASSERT_FLOAT_WITHIN(0.01, NtcConverter::Fail_celsius, converter.celsius(max_raw)); // open
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, converter.value());
+  TEST_ASSERT_FLOAT_WITHIN(0.01, NtcConverter::Fail_celsius, converter.celsius(0));       // shorted
+  TEST_ASSERT_EQUAL_UINT32(0, converter.value());
+}
+
+
+void test_max6675_converter_quarter_celsius() {
+  Max6675Converter converter;
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 25.25, converter.celsius(101));
+  TEST_ASSERT_EQUAL_UINT32(101, converter.value());
+}
+
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_measure_without_samples_keeps_temperature);
+  RUN_TEST(test_measure_converts_once_per_batch);
+  RUN_TEST(test_drive_writes_duty);
+  RUN_TEST(test_regulate_every_interval);
+  RUN_TEST(test_duty_is_clamped_control);
+  RUN_TEST(test_gains_interpolate_between_bands);
+  RUN_TEST(test_ki_change_is_bumpless);
+  RUN_TEST(test_closed_loop_reaches_set_point);
+  RUN_TEST(test_closed_loop_follows_set_point_down);
+  RUN_TEST(test_ntc_converter_at_nominal_resistance);
+  RUN_TEST(test_ntc_converter_fails_hot);
+  RUN_TEST(test_max6675_converter_quarter_celsius);
+  return UNITY_END();
+}